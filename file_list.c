@@ -1,3 +1,4 @@
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -9,12 +10,17 @@ void file_list_init(file_list_t *list) {
 }
 
 int file_list_add(file_list_t *list, const char *file_name) {
+    // Cutting the name short would silently make it name a different file
+    if (strlen(file_name) >= MAX_NAME_LEN) {
+        errno = ENAMETOOLONG;
+        return 1;
+    }
     if (list->head == NULL) {
         list->head = malloc(sizeof(node_t));
         if (list->head == NULL) {
             return 1;
         }
-        strncpy(list->head->name, file_name, MAX_NAME_LEN);
+        strcpy(list->head->name, file_name);
         list->head->next = NULL;
         list->size = 1;
         return 0;
@@ -28,7 +34,7 @@ int file_list_add(file_list_t *list, const char *file_name) {
     if (current->next == NULL) {
         return 1;
     }
-    strncpy(current->next->name, file_name, MAX_NAME_LEN);
+    strcpy(current->next->name, file_name);
     current->next->next = NULL;
     list->size++;
     return 0;
@@ -67,3 +73,65 @@ void file_list_clear(file_list_t *list) {
     list->head = NULL;
     list->size = 0;
 }
+
+void file_source_init(file_source_t *source, const file_list_t *list, FILE *stream, char delim) {
+    source->next = list == NULL ? NULL : list->head;
+    source->array = NULL;
+    source->array_len = 0;
+    source->stream = stream;
+    source->delim = delim;
+}
+
+void file_source_init_array(file_source_t *source, const char *const *array, size_t count) {
+    file_source_init(source, NULL, NULL, '\n');
+    source->array = array;
+    source->array_len = count;
+}
+
+int file_source_next(file_source_t *source, char *name, size_t len) {
+    if (source->next != NULL) {
+        strncpy(name, source->next->name, len - 1);
+        name[len - 1] = '\0';
+        source->next = source->next->next;
+        return 1;
+    }
+    if (source->array_len > 0) {
+        if (strlen(source->array[0]) >= len) {
+            source->array++;
+            source->array_len--;
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        strcpy(name, source->array[0]);
+        source->array++;
+        source->array_len--;
+        return 1;
+    }
+    if (source->stream == NULL) {
+        return 0;
+    }
+
+    size_t n = 0;
+    int c;
+    while ((c = getc(source->stream)) != EOF) {
+        if (c == source->delim) {
+            if (n == 0) {
+                continue;
+            }
+            break;
+        }
+        if (n == len - 1) {
+            // Skip the rest of the name so the source stays usable
+            while ((c = getc(source->stream)) != EOF && c != source->delim) {
+            }
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        name[n++] = c;
+    }
+    if (ferror(source->stream)) {
+        return -1;
+    }
+    name[n] = '\0';
+    return n > 0;
+}
@@ -1,7 +1,10 @@
 #ifndef _FILE_LIST_H
 #define _FILE_LIST_H
 
-#define MAX_NAME_LEN 32
+#include <stdio.h>
+
+// Large enough for any name that fits in a tar header
+#define MAX_NAME_LEN 100
 
 //  Definition of each node in the linked list
 typedef struct node {
@@ -19,6 +22,7 @@ typedef struct {
 void file_list_init(file_list_t *list);
 
 // Add a new file name to the tail of the linked list
+// Returns 0 on success, or 1 if memory runs out or the name is too long to fit (errno is ENAMETOOLONG)
 int file_list_add(file_list_t *list, const char *file_name);
 
 // Remove all entries from the list and free any memory associated with them
@@ -33,4 +37,27 @@ int file_list_contains(const file_list_t *list, const char *file_name);
 // Returns 1 if l1 is a subset of l2, 0 otherwise
 int file_list_is_subset(const file_list_t *l1, const file_list_t *l2);
 
+// Sequence of file names, read from a list or array and then, one at a time, from a stream
+// Only the current name is ever held in memory for the stream part
+typedef struct {
+    const node_t *next; // Next list entry to return, NULL once the list is used up
+    const char *const *array; // Next array entries to return, after the list
+    size_t array_len;   // Number of array entries left
+    FILE *stream;       // Stream of names read after the list, or NULL
+    char delim;         // Character terminating each name in the stream, '\n' or '\0'
+} file_source_t;
+
+// Initialize a source yielding the names in 'list' (may be NULL), followed by
+// the 'delim'-terminated names read from 'stream' (may be NULL)
+void file_source_init(file_source_t *source, const file_list_t *list, FILE *stream, char delim);
+
+// Initialize a source yielding the 'count' names in 'array', which must stay valid while it is used
+void file_source_init_array(file_source_t *source, const char *const *array, size_t count);
+
+// Copy the next name from the source into 'name', a buffer of 'len' bytes
+// Empty names in the stream are skipped
+// Returns 1 if a name was read, 0 at the end of the source, or -1 if an error
+// occurred (including a name that does not fit in 'name')
+int file_source_next(file_source_t *source, char *name, size_t len);
+
 #endif
\ No newline at end of file
@@ -1,19 +1,107 @@
+#define _GNU_SOURCE
 #include <fcntl.h>
 #include <grp.h>
 #include <math.h>
+#include <poll.h>
 #include <pwd.h>
+#include <signal.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "minitar.h"
+#include <stdint.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <limits.h>
 #define NUM_TRAILING_BLOCKS 2
 #define MAX_MSG_LEN 512
+// Size of the staging buffer for archive writes, rounded up to whole records
+#define WRITE_BUFFER_SIZE (1 << 20)
+// Offset and length alignment required for O_DIRECT writes
+#define DIRECT_IO_ALIGN 4096
+
+/*
+ * Staging buffer between member files and the archive. Data reaches the archive
+ * in large writes of whole records instead of one small write per block.
+ */
+typedef struct {
+    int fd;
+    char *buf;          // Page-aligned staging buffer
+    size_t len;         // Bytes currently staged in buf
+    size_t cap;         // Capacity of buf, a whole number of records
+    size_t record_size; // Blocking factor times BLOCK_SIZE
+    off_t offset;       // Archive offset that buf[0] will be written to
+    int direct;         // Nonzero once fd has been switched to O_DIRECT
+    size_t sync_bytes;  // fdatasync after this many bytes are written, 0 to leave it to the caller
+    size_t unsynced;    // Bytes written since the last fdatasync
+} archive_writer_t;
+
+// Contents of the journal written before an archive is appended to, recording
+// how to roll the archive back to its last good end
+typedef struct {
+    char magic[8];
+    uint64_t dev;      // Device and inode of the archive, so a journal left over
+    uint64_t ino;      // from an archive that has since been replaced is ignored
+    uint64_t old_end;  // Offset of the end-of-archive zero blocks before the append
+    uint64_t old_size; // Size of the archive file before the append
+    uint64_t checksum; // Sum of the fields above, to detect a torn journal write
+} archive_journal_t;
+
+#define JOURNAL_MAGIC "MTARJNL"
+#define JOURNAL_SUFFIX ".journal"
+
+// Where an append left the end of an archive, so the next one needn't walk every header to find it
+typedef struct {
+    dev_t dev;  // Device and inode of the archive, to notice it being replaced
+    ino_t ino;
+    off_t end;  // Offset of the end-of-archive zero blocks, or -1 if unknown
+    struct timespec ctime; // Change time of the archive right after the append
+} archive_position_t;
+
+// Bytes at the start of each upcoming member to ask the kernel to read ahead
+#define PREFETCH_BYTES (8 << 20)
+
+// A member file opened ahead of its turn by write_members
+typedef struct {
+    char name[100]; // Same size as the header name field
+    int fd;         // Open file, or -1 if it could not be opened
+    int open_errno; // Why the file could not be opened, reported at its turn
+} prefetch_slot_t;
+
+// Events that mean a watched member may need to be archived again
+#define WATCH_EVENTS (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+
+// A member file registered with inotify by watch_archive
+typedef struct {
+    int wd;         // inotify watch descriptor, or -1 if the file is not being watched
+    int changed;    // Nonzero if the file is queued for the next batch
+    size_t alias;   // 1 + index of the next entry sharing this watch descriptor, 0 if none
+    char name[100]; // Same size as the header name field
+} watch_entry_t;
+
+// State of watch_archive's inotify instance
+typedef struct {
+    int fd;
+    watch_entry_t *entries;
+    size_t count;
+    size_t capacity;
+    size_t *by_wd;     // 1 + index of the first entry for each watch descriptor, 0 if unused
+    size_t by_wd_len;
+    size_t *changed;   // Indexes of the entries queued for the next batch
+    size_t nchanged;
+    const char **batch; // Names of the files in the batch being appended
+    archive_position_t pos; // End of the archive after the last batch
+} watch_state_t;
+
+// Set by SIGINT/SIGTERM to make watch_archive archive any pending changes and return
+volatile sig_atomic_t watch_stop = 0;
 
 /*
  * Helper function to compute the checksum of a tar header block
@@ -33,19 +121,27 @@ void compute_checksum(tar_header *header) {
 
 /*
  * Populates a tar header block pointed to by 'header' with metadata about
- * the file identified by 'file_name'.
+ * the file identified by 'file_name', which is open on 'fd'.
  * Returns 0 on success or -1 if an error occurs
  */
-int fill_tar_header(tar_header *header, const char *file_name) {
+int fill_tar_header(tar_header *header, const char *file_name, int fd) {
     memset(header, 0, sizeof(tar_header));
     char err_msg[MAX_MSG_LEN];
     struct stat stat_buf;
-    // stat is a system call to inspect file metadata
-    if (stat(file_name, &stat_buf) != 0) {
+    // fstat is a system call to inspect file metadata; it uses the already open
+    // file rather than looking up the path again
+    if (fstat(fd, &stat_buf) != 0) {
         snprintf(err_msg, MAX_MSG_LEN, "Failed to stat file %s", file_name);
         perror(err_msg);
         return -1;
     }
+    // Only regular files can be archived, their size is what gets copied
+    if (!S_ISREG(stat_buf.st_mode)) {
+        errno = S_ISDIR(stat_buf.st_mode) ? EISDIR : EINVAL;
+        snprintf(err_msg, MAX_MSG_LEN, "File %s is not a regular file", file_name);
+        perror(err_msg);
+        return -1;
+    }
 
     strncpy(header->name, file_name, 100); // Name of the file, null-terminated string
     snprintf(header->mode, 8, "%07o", stat_buf.st_mode & 07777); // Permissions for file, 0-padded octal
@@ -117,159 +213,1069 @@ int remove_trailing_bytes(const char *file_name, size_t nbytes) {
     return 0;
 }
 
-//FERROR USE IMPORTANT
-int create_archive(const char *archive_name, const file_list_t *files) {
-    FILE *fp = fopen(archive_name, "w");
+/*
+ * Least common multiple of two positive sizes
+ */
+size_t lcm(size_t a, size_t b) {
+    size_t x = a, y = b;
+    while (y != 0) {
+        size_t t = x % y;
+        x = y;
+        y = t;
+    }
+    return a / x * b;
+}
+
+void archive_options_init(archive_options_t *opts) {
+    opts->blocking_factor = DEFAULT_BLOCKING_FACTOR;
+    opts->direct_io = 0;
+    opts->watch_window_ms = DEFAULT_WATCH_WINDOW_MS;
+    opts->sync_interval_mb = 0;
+    opts->prefetch_window = DEFAULT_PREFETCH_WINDOW;
+    opts->skip_unusable = 0;
+}
+
+/*
+ * Prepares 'writer' to emit archive data to 'fd', starting at byte 'start'.
+ * With O_DIRECT requested, writes have to begin on an aligned offset, so the
+ * bytes between the preceding aligned boundary and 'start' are read back into
+ * the buffer to be rewritten unchanged.
+ * Returns 0 on success or -1 if an error occurs
+ */
+int writer_init(archive_writer_t *writer, int fd, off_t start, const char *archive_name,
+                const archive_options_t *opts) {
     char err_msg[MAX_MSG_LEN];
-    //errcheck #1, check if the archive can be open
-    if(fp==NULL){
-        snprintf(err_msg, MAX_MSG_LEN, "Failed to open archive file %s", archive_name);
+    writer->fd = fd;
+    writer->len = 0;
+    writer->direct = 0;
+    writer->unsynced = 0;
+    writer->sync_bytes = (size_t)opts->sync_interval_mb << 20;
+    writer->record_size = (size_t)opts->blocking_factor * BLOCK_SIZE;
+    // Every full-buffer write is a whole number of records, and of device blocks under O_DIRECT
+    size_t unit = writer->record_size;
+    if (opts->direct_io) {
+        unit = lcm(unit, DIRECT_IO_ALIGN);
+    }
+    writer->cap = (WRITE_BUFFER_SIZE + unit - 1) / unit * unit;
+    int err = posix_memalign((void **)&writer->buf, sysconf(_SC_PAGESIZE), writer->cap);
+    if (err != 0) {
+        errno = err;
+        perror("Failed to allocate archive write buffer");
+        return -1;
+    }
+
+    writer->offset = start;
+    if (opts->direct_io) {
+        writer->offset = start - start % DIRECT_IO_ALIGN;
+    }
+    if (writer->offset < start) {
+        size_t nbytes = start - writer->offset;
+        if (pread(fd, writer->buf, nbytes, writer->offset) != nbytes) {
+            snprintf(err_msg, MAX_MSG_LEN, "Failed to read back end of archive %s", archive_name);
+            perror(err_msg);
+            free(writer->buf);
+            return -1;
+        }
+        writer->len = nbytes;
+    }
+    // A freshly created archive is already positioned at 0, and may be a pipe that can't seek
+    if (start != 0 && lseek(fd, writer->offset, SEEK_SET) == -1) {
+        snprintf(err_msg, MAX_MSG_LEN, "Failed to seek to end of archive %s", archive_name);
         perror(err_msg);
-        //You shouldn't close a NULL pointer, results in segfault
+        free(writer->buf);
         return -1;
     }
-    tar_header current_header;
-    node_t *current_node = files->head;
-    FILE *fnode;
-    while(current_node!=NULL){
-        //terminates at end of list, when current node =NULL
-        //This will not run in the event where &files is empty(Creates a 1024 byte footer and thats it) (Minitar.h says we can ignore this case anyway.)
-        if(fill_tar_header(&current_header, current_node->name) == -1){
-            //if filltar header fails...
-            snprintf(err_msg, MAX_MSG_LEN, "Function fill_tar_header failed on filename %s", current_node->name);
+
+    if (opts->direct_io) {
+        int flags = fcntl(fd, F_GETFL);
+        if (flags == -1 || fcntl(fd, F_SETFL, flags | O_DIRECT) == -1) {
+            snprintf(err_msg, MAX_MSG_LEN, "O_DIRECT unavailable for archive %s, using buffered writes",
+                     archive_name);
             perror(err_msg);
-            fclose(fp);
+        } else {
+            writer->direct = 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Writes all staged bytes to the archive and empties the buffer
+ * Returns 0 on success or -1 if an error occurs
+ */
+int writer_flush(archive_writer_t *writer) {
+    size_t done = 0;
+    while (done < writer->len) {
+        ssize_t nbytes = write(writer->fd, writer->buf + done, writer->len - done);
+        if (nbytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // The final, partial buffer need not meet O_DIRECT's size alignment
+            if (errno == EINVAL && writer->direct) {
+                int flags = fcntl(writer->fd, F_GETFL);
+                if (flags == -1 || fcntl(writer->fd, F_SETFL, flags & ~O_DIRECT) == -1) {
+                    return -1;
+                }
+                writer->direct = 0;
+                continue;
+            }
             return -1;
         }
-        if (fwrite(&current_header, 1, 512, fp)!=512){
-            //if fwrite fails.
-            snprintf(err_msg, MAX_MSG_LEN, "Failed to write %s header to archive", current_header.name);
-            perror("Error: failed to write header to archive %s");
-            fclose(fp);
+        done += nbytes;
+    }
+    writer->offset += writer->len;
+    writer->unsynced += writer->len;
+    writer->len = 0;
+    // Bounds the unsynced data, and so the final sync's latency, on large archives
+    if (writer->sync_bytes > 0 && writer->unsynced >= writer->sync_bytes) {
+        if (fdatasync(writer->fd) == -1) {
             return -1;
         }
-        fnode = fopen(current_node->name, "r");
-        //Fnode represents the file we are reading from or copying to the archive.
-        if(fnode ==NULL){
-            snprintf(err_msg, MAX_MSG_LEN, "Failed to open file %s", current_node->name);
-            perror(err_msg);
-            fclose(fp);
-            //Shouldn't close NULL file pointers
+        writer->unsynced = 0;
+    }
+    return 0;
+}
+
+/*
+ * Stages 'nbytes' bytes from 'data' for writing, or zero bytes if 'data' is NULL
+ * Returns 0 on success or -1 if an error occurs
+ */
+int writer_write(archive_writer_t *writer, const void *data, size_t nbytes) {
+    while (nbytes > 0) {
+        size_t chunk = writer->cap - writer->len;
+        if (chunk > nbytes) {
+            chunk = nbytes;
+        }
+        if (data == NULL) {
+            memset(writer->buf + writer->len, 0, chunk);
+        } else {
+            memcpy(writer->buf + writer->len, data, chunk);
+            data = (const char *)data + chunk;
+        }
+        writer->len += chunk;
+        nbytes -= chunk;
+        if (writer->len == writer->cap && writer_flush(writer) == -1) {
             return -1;
         }
-        else{
-        char buffer[512];
-        memset(buffer, 0, 512);
-        while(fread(buffer, sizeof(char),512, fnode)>0){ //There is no need to check length of read here, as buffer is always filled with 0's, which must be added to the end of the file in the archive
-        //Therefore no need to error check this fread. 
-            if(fwrite(buffer, sizeof(char), 512, fp)!=512){
-                snprintf(err_msg, MAX_MSG_LEN, "Failed to write file %s to archive", current_node->name);
-                perror(err_msg);
-                fclose(fp);
-                fclose(fnode);
-                return -1;
+    }
+    return 0;
+}
+
+/*
+ * Copies 'size' bytes of member data from 'fd' straight into the write buffer,
+ * then zero-pads the member out to a whole block. If the file shrank since its
+ * header was written, the missing bytes are zero-filled so the archive stays
+ * consistent with the header.
+ * Returns 0 on success or -1 if an error occurs
+ */
+int writer_copy_member(archive_writer_t *writer, int fd, size_t size) {
+    size_t remaining = size;
+    while (remaining > 0) {
+        size_t chunk = writer->cap - writer->len;
+        if (chunk > remaining) {
+            chunk = remaining;
+        }
+        ssize_t nbytes = read(fd, writer->buf + writer->len, chunk);
+        if (nbytes == -1) {
+            if (errno == EINTR) {
+                continue;
             }
-            //reset buffer to 0's (This will always set)
-            memset(buffer, 0, 512);
+            return -1;
+        }
+        if (nbytes == 0) {
+            break;
+        }
+        writer->len += nbytes;
+        remaining -= nbytes;
+        if (writer->len == writer->cap && writer_flush(writer) == -1) {
+            return -1;
+        }
+    }
+    return writer_write(writer, NULL, remaining + (BLOCK_SIZE - size % BLOCK_SIZE) % BLOCK_SIZE);
+}
+
+/*
+ * Writes the two zero blocks marking the end of the archive, pads the archive
+ * out to a whole record and flushes everything. The final archive size is
+ * stored in 'end' if it is not NULL.
+ * Returns 0 on success or -1 if an error occurs
+ */
+int writer_finish(archive_writer_t *writer, off_t *end) {
+    if (writer_write(writer, NULL, NUM_TRAILING_BLOCKS * BLOCK_SIZE) == -1) {
+        return -1;
+    }
+    off_t size = writer->offset + writer->len;
+    if (writer_write(writer, NULL, (writer->record_size - size % writer->record_size) % writer->record_size) == -1) {
+        return -1;
+    }
+    if (writer_flush(writer) == -1) {
+        return -1;
+    }
+    if (end != NULL) {
+        *end = writer->offset;
+    }
+    return 0;
+}
+
+/*
+ * Finds the end of the member data in the archive open on 'fd': the offset of
+ * the first all-zero header block. Archives padded to a whole record end in
+ * more than two zero blocks, so this can't be found by seeking back from the
+ * end of the file.
+ * Returns 0 on success or -1 if an error occurs
+ */
+int find_archive_end(int fd, off_t *end) {
+    tar_header header;
+    off_t offset = 0;
+    while (1) {
+        ssize_t nbytes = pread(fd, &header, BLOCK_SIZE, offset);
+        if (nbytes == -1) {
+            return -1;
+        }
+        if (nbytes < BLOCK_SIZE || header.name[0] == '\0') {
+            break;
         }
+        offset += BLOCK_SIZE + BLOCK_SIZE * ((strtol(header.size, NULL, 8) + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    }
+    *end = offset;
+    return 0;
+}
+
+/*
+ * Checks whether 'pos' still gives the end of the archive open on 'fd', whose
+ * status is 'stat_buf'. Padding to a whole record usually leaves the size
+ * unchanged when someone else appends, but every append overwrites the zero
+ * block at the old end with a header, so that block is checked instead.
+ * Returns 1 if it does, or 0 if the end must be found again
+ */
+int position_is_current(int fd, const struct stat *stat_buf, const archive_position_t *pos) {
+    if (pos == NULL || pos->end < 0 || pos->dev != stat_buf->st_dev || pos->ino != stat_buf->st_ino ||
+        pos->ctime.tv_sec != stat_buf->st_ctim.tv_sec || pos->ctime.tv_nsec != stat_buf->st_ctim.tv_nsec ||
+        stat_buf->st_size < pos->end + 2 * BLOCK_SIZE) {
+        return 0;
+    }
+    tar_header header;
+    return pread(fd, &header, BLOCK_SIZE, pos->end) == BLOCK_SIZE && header.name[0] == '\0';
+}
+
+/*
+ * Opens the file named in 'slot' and asks the kernel to start reading it in,
+ * so the read overlaps with writing the members before it
+ */
+void prefetch_open(prefetch_slot_t *slot) {
+    slot->fd = open(slot->name, O_RDONLY);
+    if (slot->fd == -1) {
+        slot->open_errno = errno;
+        return;
+    }
+    // Purely advisory, so failures are ignored
+    posix_fadvise(slot->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(slot->fd, 0, PREFETCH_BYTES, POSIX_FADV_WILLNEED);
+}
+
+/*
+ * Writes a header block followed by the contents of each file named by 'names'
+ * Names are consumed one at a time, so memory use does not grow with the number of members.
+ * The next 'opts->prefetch_window' members are kept open and prefetched while
+ * the current one is written.
+ * Returns 0 on success or -1 if an error occurs
+ */
+int write_members(archive_writer_t *writer, file_source_t *names, const archive_options_t *opts) {
+    char err_msg[MAX_MSG_LEN];
+    tar_header current_header;
+    // A ring of the current member followed by the prefetched ones
+    size_t nslots = opts->prefetch_window + 1;
+    prefetch_slot_t *slots = malloc(nslots * sizeof(prefetch_slot_t));
+    if (slots == NULL) {
+        perror("Failed to allocate prefetch window");
+        return -1;
+    }
+    size_t head = 0;
+    size_t count = 0;
+    int status = 1;
+    int ret = -1;
+    while (1) {
+        while (status == 1 && count < nslots) {
+            prefetch_slot_t *slot = &slots[(head + count) % nslots];
+            status = file_source_next(names, slot->name, sizeof(slot->name));
+            if (status == 1) {
+                prefetch_open(slot);
+                count++;
+            }
+        }
+        if (status == -1) {
+            perror("Failed to read next member file name");
+            goto out;
         }
-        current_node = current_node->next;
-        fclose(fnode);
+        if (count == 0) {
+            break;
+        }
+
+        prefetch_slot_t *slot = &slots[head];
+        int usable = 1;
+        if (slot->fd == -1) {
+            errno = slot->open_errno;
+            snprintf(err_msg, MAX_MSG_LEN, "Failed to open file %s", slot->name);
+            perror(err_msg);
+            usable = 0;
+        } else if (fill_tar_header(&current_header, slot->name, slot->fd) == -1) {
+            snprintf(err_msg, MAX_MSG_LEN, "Function fill_tar_header failed on filename %s", slot->name);
+            perror(err_msg);
+            usable = 0;
+        }
+        if (!usable) {
+            if (!opts->skip_unusable) {
+                goto out;
+            }
+            // Nothing has been written for this member yet, so it can be left out
+            if (slot->fd != -1) {
+                close(slot->fd);
+            }
+            head = (head + 1) % nslots;
+            count--;
+            continue;
+        }
+        if (writer_write(writer, &current_header, BLOCK_SIZE) == -1 ||
+            writer_copy_member(writer, slot->fd, strtol(current_header.size, NULL, 8)) == -1) {
+            snprintf(err_msg, MAX_MSG_LEN, "Failed to write file %s to archive", slot->name);
+            perror(err_msg);
+            goto out;
+        }
+        close(slot->fd);
+        head = (head + 1) % nslots;
+        count--;
     }
-    char zero[1024];
-    memset(zero, 0, 1024);
-    //this is to set up the footer, where the last 1024 bytes are simply made to be 0. 
-    if(fwrite(zero, sizeof(char), 1024, fp)!=1024){
-        snprintf(err_msg, MAX_MSG_LEN, "fwrite failed to append 1024 0's at the end of archive %s", archive_name);
+    ret = 0;
+
+out:
+    for (size_t i = 0; i < count; i++) {
+        if (slots[(head + i) % nslots].fd != -1) {
+            close(slots[(head + i) % nslots].fd);
+        }
+    }
+    free(slots);
+    return ret;
+}
+
+/*
+ * Makes a rename or unlink of 'path' durable by syncing its parent directory
+ * Returns 0 on success or -1 if an error occurs
+ */
+int sync_parent_dir(const char *path) {
+    char dir[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    if (slash == NULL) {
+        strcpy(dir, ".");
+    } else if (slash == path) {
+        strcpy(dir, "/");
+    } else {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+    }
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd == -1) {
+        return -1;
+    }
+    int ret = fsync(fd);
+    close(fd);
+    return ret;
+}
+
+uint64_t journal_checksum(const archive_journal_t *journal) {
+    return journal->dev + journal->ino + journal->old_end + journal->old_size;
+}
+
+/*
+ * Reads the journal named 'journal_name' of the archive open on 'fd' into 'journal'
+ * Returns 1 if it records an append to this archive, 0 if it is torn or belongs
+ * to an archive that has since been replaced, or -1 if an error occurs
+ * (errno is ENOENT if there is no journal)
+ */
+int read_journal(const char *journal_name, int fd, archive_journal_t *journal) {
+    int jfd = open(journal_name, O_RDONLY);
+    if (jfd == -1) {
+        return -1;
+    }
+    ssize_t nbytes = read(jfd, journal, sizeof(*journal));
+    close(jfd);
+    struct stat stat_buf;
+    if (nbytes == -1 || fstat(fd, &stat_buf) == -1) {
+        return -1;
+    }
+    return nbytes == sizeof(*journal) && memcmp(journal->magic, JOURNAL_MAGIC, sizeof(journal->magic)) == 0 &&
+           journal->checksum == journal_checksum(journal) && stat_buf.st_dev == journal->dev &&
+           stat_buf.st_ino == journal->ino;
+}
+
+/*
+ * Rolls the archive identified by 'archive_name' and open for writing on 'fd'
+ * back to the end recorded in its journal, then removes the journal. Journals
+ * that are torn or belong to a replaced archive are just removed.
+ * The caller must hold an exclusive lock on 'fd', so no append is in progress.
+ * Returns 0 on success (including when there is no journal) or -1 if an error occurs
+ */
+int rollback_archive(const char *archive_name, int fd) {
+    char err_msg[MAX_MSG_LEN];
+    char journal_name[PATH_MAX];
+    snprintf(journal_name, PATH_MAX, "%s%s", archive_name, JOURNAL_SUFFIX);
+    archive_journal_t journal;
+    int status = read_journal(journal_name, fd, &journal);
+    if (status == -1) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    // Truncating to the old end and extending again restores the zeroed footer and record padding
+    if (status == 1 && (ftruncate(fd, journal.old_end) == -1 || ftruncate(fd, journal.old_size) == -1 ||
+                        fdatasync(fd) == -1)) {
+        snprintf(err_msg, MAX_MSG_LEN, "Failed to roll back interrupted append to archive %s", archive_name);
         perror(err_msg);
-        fclose(fp);
         return -1;
     }
-    fclose(fp);
+    if (unlink(journal_name) == -1 || sync_parent_dir(journal_name) == -1) {
+        snprintf(err_msg, MAX_MSG_LEN, "Failed to remove journal of archive %s", archive_name);
+        perror(err_msg);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Takes the flock 'operation' on the archive 'archive_name', open with 'flags'
+ * on 'fd'. The archive may be replaced while we wait for the lock, so if the
+ * name no longer refers to the locked file, it is closed and the new archive
+ * is opened and locked instead.
+ * Returns the locked file descriptor, or -1 with 'fd' closed if an error occurs
+ */
+int relock_archive(const char *archive_name, int fd, int flags, int operation) {
+    while (1) {
+        struct stat locked;
+        struct stat current;
+        if (flock(fd, operation) == -1 || fstat(fd, &locked) == -1 || stat(archive_name, &current) == -1) {
+            int saved_errno = errno;
+            close(fd);
+            errno = saved_errno;
+            return -1;
+        }
+        if (locked.st_dev == current.st_dev && locked.st_ino == current.st_ino) {
+            return fd;
+        }
+        close(fd);
+        fd = open(archive_name, flags);
+        if (fd == -1) {
+            return -1;
+        }
+    }
+}
+
+/*
+ * Rolls the archive identified by 'archive_name' back to its last good end if
+ * an append to it crashed, as recorded by its journal.
+ * If an append is still in progress (another process holds the archive's lock),
+ * or the archive can't be rolled back by this user, the journal is left alone
+ * for lock_archive_shared to find.
+ * Returns 0 on success or -1 if an error occurs
+ */
+int recover_archive(const char *archive_name) {
+    char journal_name[PATH_MAX];
+    snprintf(journal_name, PATH_MAX, "%s%s", archive_name, JOURNAL_SUFFIX);
+    if (access(journal_name, F_OK) != 0) {
+        return 0;
+    }
+    int fd = open(archive_name, O_RDWR);
+    if (fd == -1) {
+        // A missing archive is reported by the caller when it opens it
+        return errno == ENOENT || errno == EACCES || errno == EPERM || errno == EROFS ? 0 : -1;
+    }
+    // The journal is only read once the lock is held, so an append that commits
+    // while we wait for it is never mistaken for a crashed one
+    fd = relock_archive(archive_name, fd, O_RDWR, LOCK_EX | LOCK_NB);
+    if (fd == -1) {
+        return errno == EWOULDBLOCK || errno == ENOENT ? 0 : -1;
+    }
+    // If this fails, the journal is left for lock_archive_shared to find
+    rollback_archive(archive_name, fd);
+    close(fd);
+    return 0;
+}
+
+/*
+ * Takes a shared lock on the archive 'archive_name' open on 'fd', so no append
+ * writes to it while it is read. If an append already holds the lock, its
+ * journal gives the last good end instead, and the caller reads up to there
+ * without the lock. Either way, the last good end is stored in 'limit' if a
+ * journal records one, otherwise 'limit' is set to -1.
+ * Returns 0 on success or -1 if an error occurs
+ */
+int lock_archive_shared(const char *archive_name, int fd, off_t *limit) {
+    char journal_name[PATH_MAX];
+    snprintf(journal_name, PATH_MAX, "%s%s", archive_name, JOURNAL_SUFFIX);
+    // An append holds the lock for a moment before its journal is written and
+    // after it is removed, so a busy lock without a journal is just retried
+    struct timespec retry_delay = {0, 10 * 1000 * 1000};
+    while (1) {
+        int locked = flock(fd, LOCK_SH | LOCK_NB) == 0;
+        if (!locked && errno != EWOULDBLOCK) {
+            return -1;
+        }
+        archive_journal_t journal;
+        int status = read_journal(journal_name, fd, &journal);
+        if (status == -1 && errno != ENOENT) {
+            return -1;
+        }
+        if (status == 1 || locked) {
+            // Left behind by a crashed append this user couldn't roll back, if we hold the lock
+            *limit = status == 1 ? (off_t)journal.old_end : -1;
+            return 0;
+        }
+        nanosleep(&retry_delay, NULL);
+    }
+}
+
+/*
+ * Durably records that the archive open on 'fd' ends at 'old_end' and is
+ * 'old_size' bytes long, before anything past 'old_end' is overwritten
+ * Returns 0 on success or -1 if an error occurs
+ */
+int write_journal(const char *archive_name, int fd, off_t old_end, off_t old_size) {
+    char journal_name[PATH_MAX];
+    snprintf(journal_name, PATH_MAX, "%s%s", archive_name, JOURNAL_SUFFIX);
+    struct stat stat_buf;
+    if (fstat(fd, &stat_buf) == -1) {
+        return -1;
+    }
+    archive_journal_t journal;
+    memset(&journal, 0, sizeof(journal));
+    memcpy(journal.magic, JOURNAL_MAGIC, sizeof(journal.magic));
+    journal.dev = stat_buf.st_dev;
+    journal.ino = stat_buf.st_ino;
+    journal.old_end = old_end;
+    journal.old_size = old_size;
+    journal.checksum = journal_checksum(&journal);
+
+    // Readable by anyone who can read the archive, so they can stop at the last good end
+    int jfd = open(journal_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (jfd == -1) {
+        return -1;
+    }
+    if (write(jfd, &journal, sizeof(journal)) != sizeof(journal) || fdatasync(jfd) == -1) {
+        close(jfd);
+        unlink(journal_name);
+        return -1;
+    }
+    close(jfd);
+    return sync_parent_dir(journal_name);
+}
+
+/*
+ * Writes all members and the end of the archive through a writer on 'fd',
+ * starting at offset 'start'. The offset where the member data ends (the
+ * start of the zero blocks) is stored in 'end', and the final archive size in 'size'.
+ * Returns 0 on success or -1 if an error occurs
+ */
+int write_archive(int fd, off_t start, off_t *end, off_t *size, const char *archive_name, file_source_t *names,
+                  const archive_options_t *opts) {
+    char err_msg[MAX_MSG_LEN];
+    archive_writer_t writer;
+    if (writer_init(&writer, fd, start, archive_name, opts) == -1) {
+        return -1;
+    }
+    // This will not write any members in the event where names is empty, leaving just the footer
+    if (write_members(&writer, names, opts) == -1) {
+        free(writer.buf);
+        return -1;
+    }
+    *end = writer.offset + writer.len;
+    if (writer_finish(&writer, size) == -1) {
+        snprintf(err_msg, MAX_MSG_LEN, "Failed to write end of archive %s", archive_name);
+        perror(err_msg);
+        free(writer.buf);
+        return -1;
+    }
+    free(writer.buf);
     return 0;
 }
-//I was told I never need to error check fclose
 
-int append_files_to_archive(const char *archive_name, const file_list_t *files) {
+int create_archive(const char *archive_name, file_source_t *names, const archive_options_t *opts) {
     char err_msg[MAX_MSG_LEN];
-    FILE *checkexistence = fopen(archive_name, "r");
-    //the reason I make a whole new file is to make certain that the file exists prior to the read and write functions.
-    //I assume that this would not work when opening an read/write file so I did an extra step.
-    if(checkexistence==NULL){
-        snprintf(err_msg, MAX_MSG_LEN, "Archive %s Does not exist, and cannot be appended", archive_name);
+    off_t end;
+    off_t size;
+    struct stat stat_buf;
+    int exists = stat(archive_name, &stat_buf) == 0;
+    if (exists && !S_ISREG(stat_buf.st_mode)) {
+        // Pipes, tapes and other devices are written directly, as they can't be replaced by a rename
+        int fd = open(archive_name, O_WRONLY | O_TRUNC);
+        if (fd == -1) {
+            snprintf(err_msg, MAX_MSG_LEN, "Failed to open archive file %s", archive_name);
+            perror(err_msg);
+            return -1;
+        }
+        if (write_archive(fd, 0, &end, &size, archive_name, names, opts) == -1) {
+            close(fd);
+            return -1;
+        }
+        return close(fd);
+    }
+
+    // The new archive is built beside the old one and renamed over it once complete,
+    // so a crash leaves either the old archive or the new one, never a mix
+    char temp_name[PATH_MAX];
+    if (snprintf(temp_name, PATH_MAX, "%s.XXXXXX", archive_name) >= PATH_MAX) {
+        errno = ENAMETOOLONG;
+        snprintf(err_msg, MAX_MSG_LEN, "Failed to open archive file %s", archive_name);
         perror(err_msg);
         return -1;
     }
-    fclose(checkexistence);
-    FILE *fp = fopen(archive_name, "r+");
-    if(fp==NULL){
+    int fd = mkstemp(temp_name);
+    if (fd == -1) {
         snprintf(err_msg, MAX_MSG_LEN, "Failed to open archive file %s", archive_name);
-        //Can't close a null file pointer results in error
         perror(err_msg);
         return -1;
     }
-    if(fseek(fp, -1024, SEEK_END)!=0){
-        snprintf(err_msg, MAX_MSG_LEN, "Failed to Fseek to start of archive footer %s", archive_name);
+    // mkstemp creates the file 0600, give it the permissions fopen(..., "w") would have
+    mode_t mode = stat_buf.st_mode & 07777;
+    if (!exists) {
+        mode_t mask = umask(0);
+        umask(mask);
+        mode = 0666 & ~mask;
+    }
+    if (fchmod(fd, mode) == -1 || write_archive(fd, 0, &end, &size, archive_name, names, opts) == -1) {
+        close(fd);
+        unlink(temp_name);
+        return -1;
+    }
+    // The one sync of the whole operation, so the rename can't expose unwritten data
+    if (fdatasync(fd) == -1 || close(fd) == -1) {
+        snprintf(err_msg, MAX_MSG_LEN, "Failed to sync archive file %s", archive_name);
         perror(err_msg);
-        fclose(fp);
+        unlink(temp_name);
         return -1;
     }
-    tar_header current_header;
-    node_t *current_node = files->head;
-    FILE *fnode;
-    while(current_node!=NULL){
-        if(fill_tar_header(&current_header, current_node->name) == -1){
-            snprintf(err_msg, MAX_MSG_LEN, "Failed to populate header %s", current_node->name);
-            perror(err_msg);
+    // Wait for any append to the old archive to finish, so it isn't lost to the rename
+    int old_fd = -1;
+    if (exists) {
+        old_fd = open(archive_name, O_RDONLY);
+        if (old_fd != -1) {
+            old_fd = relock_archive(archive_name, old_fd, O_RDONLY, LOCK_EX);
+        }
+    }
+    if (rename(temp_name, archive_name) == -1 || sync_parent_dir(archive_name) == -1) {
+        snprintf(err_msg, MAX_MSG_LEN, "Failed to replace archive file %s", archive_name);
+        perror(err_msg);
+        unlink(temp_name);
+        if (old_fd != -1) {
+            close(old_fd);
+        }
+        return -1;
+    }
+    if (old_fd != -1) {
+        close(old_fd);
+    }
+    // A journal left by an interrupted append to the replaced archive no longer applies
+    return recover_archive(archive_name);
+}
+
+/*
+ * Appends each file named by 'names' to the archive 'archive_name', like
+ * append_files_to_archive. If 'pos' is not NULL, it records where the
+ * previous call left the end of the archive; if nobody has appended to or
+ * replaced the archive since, the end is taken from there instead of walking
+ * every header again.
+ * 'pos' is updated to the new end on success.
+ * Returns 0 on success or -1 if an error occurs
+ */
+int append_files_at(const char *archive_name, file_source_t *names, const archive_options_t *opts,
+                    archive_position_t *pos) {
+    char err_msg[MAX_MSG_LEN];
+    int fd = open(archive_name, O_RDWR);
+    if (fd == -1) {
+        snprintf(err_msg, MAX_MSG_LEN, "Archive %s Does not exist, and cannot be appended", archive_name);
+        perror(err_msg);
+        return -1;
+    }
+    // Held until the append is committed: appends take turns, and readers
+    // finding a journal while it is held know the append is still in progress
+    fd = relock_archive(archive_name, fd, O_RDWR, LOCK_EX);
+    if (fd == -1) {
+        snprintf(err_msg, MAX_MSG_LEN, "Failed to lock archive %s", archive_name);
+        perror(err_msg);
+        return -1;
+    }
+    if (rollback_archive(archive_name, fd) == -1) {
+        close(fd);
+        return -1;
+    }
+    // New members overwrite the old footer and record padding
+    off_t end;
+    struct stat stat_buf;
+    if (fstat(fd, &stat_buf) == -1) {
+        snprintf(err_msg, MAX_MSG_LEN, "Failed to find end of archive %s", archive_name);
+        perror(err_msg);
+        close(fd);
+        return -1;
+    }
+    off_t size = stat_buf.st_size;
+    if (position_is_current(fd, &stat_buf, pos)) {
+        end = pos->end;
+    } else if (find_archive_end(fd, &end) == -1) {
+        snprintf(err_msg, MAX_MSG_LEN, "Failed to find end of archive %s", archive_name);
+        perror(err_msg);
+        close(fd);
+        return -1;
+    }
+    if (write_journal(archive_name, fd, end, size) == -1) {
+        snprintf(err_msg, MAX_MSG_LEN, "Failed to write journal for archive %s", archive_name);
+        perror(err_msg);
+        close(fd);
+        return -1;
+    }
+    if (write_archive(fd, end, &end, &size, archive_name, names, opts) == -1) {
+        rollback_archive(archive_name, fd);
+        close(fd);
+        return -1;
+    }
+    // The old archive may have been padded with a larger blocking factor
+    if (ftruncate(fd, size) == -1) {
+        snprintf(err_msg, MAX_MSG_LEN, "Failed to truncate archive %s", archive_name);
+        perror(err_msg);
+        rollback_archive(archive_name, fd);
+        close(fd);
+        return -1;
+    }
+    // The one sync of the whole operation; the append only counts once it is on disk
+    if (fdatasync(fd) == -1) {
+        snprintf(err_msg, MAX_MSG_LEN, "Failed to sync archive file %s", archive_name);
+        perror(err_msg);
+        rollback_archive(archive_name, fd);
+        close(fd);
+        return -1;
+    }
+    // Committed, so discarding the journal makes the new end of archive the last good one
+    char journal_name[PATH_MAX];
+    snprintf(journal_name, PATH_MAX, "%s%s", archive_name, JOURNAL_SUFFIX);
+    if (unlink(journal_name) == -1 || sync_parent_dir(journal_name) == -1) {
+        snprintf(err_msg, MAX_MSG_LEN, "Failed to remove journal of archive %s", archive_name);
+        perror(err_msg);
+        close(fd);
+        return -1;
+    }
+    // Only trusted by the next call if nothing has touched the archive since
+    if (pos != NULL) {
+        pos->end = fstat(fd, &stat_buf) == 0 ? end : -1;
+        pos->dev = stat_buf.st_dev;
+        pos->ino = stat_buf.st_ino;
+        pos->ctime = stat_buf.st_ctim;
+    }
+    // Closing releases the lock
+    if (close(fd) == -1) {
+        snprintf(err_msg, MAX_MSG_LEN, "Failed to close archive file %s", archive_name);
+        perror(err_msg);
+        return -1;
+    }
+    return 0;
+}
+
+int append_files_to_archive(const char *archive_name, file_source_t *names, const archive_options_t *opts) {
+    return append_files_at(archive_name, names, opts, NULL);
+}
+
+void watch_handle_signal(int sig) {
+    watch_stop = 1;
+}
+
+/*
+ * Registers 'state->entries[index]' with inotify. If the path names a file
+ * that is already watched (a hard link, or a file renamed over another
+ * member), the entries share the watch descriptor and its events queue both.
+ * Returns 0 on success, 1 if the same name is already watched, or -1 if an error occurs
+ */
+int watch_add(watch_state_t *state, size_t index) {
+    watch_entry_t *entry = &state->entries[index];
+    int wd = inotify_add_watch(state->fd, entry->name, WATCH_EVENTS);
+    if (wd == -1) {
+        return -1;
+    }
+    if (wd >= state->by_wd_len) {
+        size_t len = 2 * wd + 16;
+        size_t *by_wd = realloc(state->by_wd, len * sizeof(size_t));
+        if (by_wd == NULL) {
             return -1;
         }
-        if(fwrite(&current_header, 1, 512, fp)!=512){
-            snprintf(err_msg, MAX_MSG_LEN, "invalid header length, couldn't write header to archive %s", current_node->name);
-            perror(err_msg);
-            fclose(fp);
+        memset(by_wd + state->by_wd_len, 0, (len - state->by_wd_len) * sizeof(size_t));
+        state->by_wd = by_wd;
+        state->by_wd_len = len;
+    }
+    for (size_t i = state->by_wd[wd]; i != 0; i = state->entries[i - 1].alias) {
+        if (i == index + 1 || strcmp(state->entries[i - 1].name, entry->name) == 0) {
+            return 1;
+        }
+    }
+    entry->alias = state->by_wd[wd];
+    state->by_wd[wd] = index + 1;
+    entry->wd = wd;
+    return 0;
+}
+
+/*
+ * Queues 'state->entries[index]' for the next batch, if it isn't already
+ */
+void watch_mark_changed(watch_state_t *state, size_t index) {
+    if (!state->entries[index].changed) {
+        state->entries[index].changed = 1;
+        state->changed[state->nchanged++] = index;
+    }
+}
+
+/*
+ * Drains the inotify instance, queueing each file an event refers to
+ * Returns 0 on success or -1 if an error occurs
+ */
+int watch_read_events(watch_state_t *state) {
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (1) {
+        ssize_t nbytes = read(state->fd, buffer, sizeof(buffer));
+        if (nbytes == -1) {
+            if (errno == EAGAIN) {
+                return 0;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
             return -1;
         }
-        fnode = fopen(current_node->name, "r");
-        if(fnode==NULL){
-            snprintf(err_msg, MAX_MSG_LEN, "Failed to open file %s", current_node->name);
+        for (char *ptr = buffer; ptr < buffer + nbytes;) {
+            struct inotify_event *event = (struct inotify_event *)ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                // Events were dropped, so any file may have changed
+                for (size_t i = 0; i < state->count; i++) {
+                    watch_mark_changed(state, i);
+                }
+                continue;
+            }
+            if (event->wd < 0 || event->wd >= state->by_wd_len || state->by_wd[event->wd] == 0) {
+                // A watch we have already dropped, e.g. the IN_IGNORED following a removal
+                continue;
+            }
+            // The file was replaced (e.g. an editor saving via rename), so its paths are watched again before the next batch
+            int removed = event->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED);
+            if (event->mask & IN_MOVE_SELF) {
+                inotify_rm_watch(state->fd, event->wd);
+            }
+            size_t next;
+            for (size_t i = state->by_wd[event->wd]; i != 0; i = next) {
+                watch_entry_t *entry = &state->entries[i - 1];
+                next = entry->alias;
+                if (removed) {
+                    entry->wd = -1;
+                    entry->alias = 0;
+                }
+                watch_mark_changed(state, i - 1);
+            }
+            if (removed) {
+                state->by_wd[event->wd] = 0;
+            }
+        }
+    }
+}
+
+/*
+ * Appends the current version of each queued file to the archive, as one batch
+ * Files that have been replaced are watched again, and files that no longer
+ * exist are dropped from the watch. Files that can't be archived are reported
+ * and left out of the batch rather than failing it.
+ * Returns 0 on success or -1 if an error occurs
+ */
+int watch_flush(watch_state_t *state, const char *archive_name, const archive_options_t *opts) {
+    char err_msg[MAX_MSG_LEN];
+    size_t nbatch = 0;
+    for (size_t i = 0; i < state->nchanged; i++) {
+        watch_entry_t *entry = &state->entries[state->changed[i]];
+        entry->changed = 0;
+        if (entry->wd == -1 && watch_add(state, state->changed[i]) == -1) {
+            snprintf(err_msg, MAX_MSG_LEN, "No longer watching %s", entry->name);
             perror(err_msg);
-            fclose(fp);
-            //Can't close a null file pointer results in error (segfault)
+            continue;
+        }
+        state->batch[nbatch++] = entry->name;
+    }
+    state->nchanged = 0;
+    if (nbatch == 0) {
+        return 0;
+    }
+    archive_options_t batch_opts = *opts;
+    batch_opts.skip_unusable = 1;
+    file_source_t names;
+    file_source_init_array(&names, state->batch, nbatch);
+    return append_files_at(archive_name, &names, &batch_opts, &state->pos);
+}
+
+/*
+ * Runs the watch loop: waits for the first change, keeps collecting changes
+ * until the window has passed, then archives the batch.
+ * SIGINT and SIGTERM must be blocked by the caller; they are only let through
+ * while waiting in ppoll, so a signal can't slip in between checking
+ * watch_stop and starting to wait.
+ * Returns 0 on success or -1 if an error occurs
+ */
+int watch_loop(watch_state_t *state, const char *archive_name, const archive_options_t *opts,
+               const sigset_t *wait_mask) {
+    struct pollfd pfd = {.fd = state->fd, .events = POLLIN};
+    struct timespec deadline;
+    while (!watch_stop) {
+        struct timespec timeout;
+        struct timespec *timeout_ptr = NULL;
+        if (state->nchanged > 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            timeout.tv_sec = deadline.tv_sec - now.tv_sec;
+            timeout.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+            if (timeout.tv_nsec < 0) {
+                timeout.tv_sec--;
+                timeout.tv_nsec += 1000000000L;
+            }
+            if (timeout.tv_sec < 0) {
+                timeout.tv_sec = 0;
+                timeout.tv_nsec = 0;
+            }
+            timeout_ptr = &timeout;
+        }
+        int nready = ppoll(&pfd, 1, timeout_ptr, wait_mask);
+        if (nready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Failed to wait for file changes");
             return -1;
         }
-        char buffer[512];
-        memset(buffer, 0, 512);
-        while(fread(buffer, sizeof(char),512, fnode)>0){
-        //There is no need to check length of read here, as buffer is always filled with 0's, which must be added to the end of the file in the archive
-        //Therefore no need to error check this fread. (It will always be 512) Confirmed by TA
-            if(fwrite(buffer, sizeof(char), 512, fp)!=512){
-                snprintf(err_msg, MAX_MSG_LEN, "Failed to write file %s to archive ", current_node->name);
-                perror(err_msg);
-                fclose(fp);
-                fclose(fnode);
+        if (nready > 0) {
+            int was_idle = state->nchanged == 0;
+            if (watch_read_events(state) == -1) {
+                perror("Failed to read file change events");
                 return -1;
             }
-            memset(buffer, 0, 512);
-            //reset buffer to all 0's
+            // The window starts at the first change of a batch
+            if (was_idle && state->nchanged > 0) {
+                clock_gettime(CLOCK_MONOTONIC, &deadline);
+                deadline.tv_sec += opts->watch_window_ms / 1000;
+                deadline.tv_nsec += (opts->watch_window_ms % 1000) * 1000000L;
+                if (deadline.tv_nsec >= 1000000000L) {
+                    deadline.tv_sec++;
+                    deadline.tv_nsec -= 1000000000L;
+                }
+            }
+        } else if (watch_flush(state, archive_name, opts) == -1) {
+            return -1;
         }
-        current_node = current_node->next;
-        fclose(fnode);
     }
-    char zero[1024];
-    //footer all bytes are 0, and written to archive
-    memset(zero, 0, 1024);
-    if(fwrite(zero, sizeof(char), 1024, fp)!=1024){
-        snprintf(err_msg, MAX_MSG_LEN, "fwrite failed to append 1024 0's at the end of archive %s", archive_name);
+    // Don't lose changes that arrived just before we were stopped
+    if (state->nchanged > 0) {
+        return watch_flush(state, archive_name, opts);
+    }
+    return 0;
+}
+
+int watch_archive(const char *archive_name, file_source_t *names, const archive_options_t *opts) {
+    char err_msg[MAX_MSG_LEN];
+    if (access(archive_name, R_OK | W_OK) != 0) {
+        snprintf(err_msg, MAX_MSG_LEN, "Archive %s cannot be watched", archive_name);
         perror(err_msg);
-        fclose(fp);
         return -1;
     }
-    fclose(fp);
-    return 0;
-    //complete
+    watch_state_t state;
+    memset(&state, 0, sizeof(state));
+    state.pos.end = -1;
+    state.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (state.fd == -1) {
+        perror("Failed to initialize inotify");
+        return -1;
+    }
+
+    int ret = -1;
+    int status;
+    watch_entry_t *entry;
+    while (1) {
+        if (state.count == state.capacity) {
+            size_t capacity = state.capacity == 0 ? 64 : 2 * state.capacity;
+            watch_entry_t *entries = realloc(state.entries, capacity * sizeof(watch_entry_t));
+            if (entries == NULL) {
+                perror("Failed to allocate watch list");
+                goto out;
+            }
+            state.entries = entries;
+            state.capacity = capacity;
+        }
+        entry = &state.entries[state.count];
+        status = file_source_next(names, entry->name, sizeof(entry->name));
+        if (status != 1) {
+            break;
+        }
+        entry->changed = 0;
+        entry->wd = -1;
+        entry->alias = 0;
+        status = watch_add(&state, state.count);
+        if (status == -1) {
+            snprintf(err_msg, MAX_MSG_LEN, "Failed to watch file %s", entry->name);
+            perror(err_msg);
+            goto out;
+        }
+        // The same name given twice only needs to be watched once
+        if (status == 0) {
+            state.count++;
+        }
+    }
+    if (status == -1) {
+        perror("Failed to read next member file name");
+        goto out;
+    }
+    state.changed = malloc((state.count + 1) * sizeof(size_t));
+    state.batch = malloc((state.count + 1) * sizeof(char *));
+    if (state.changed == NULL || state.batch == NULL) {
+        perror("Failed to allocate watch list");
+        goto out;
+    }
+
+    // Stop signals stay blocked except while waiting in ppoll
+    sigset_t stop_signals;
+    sigset_t wait_mask;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &stop_signals, &wait_mask) == -1) {
+        perror("Failed to block signals");
+        goto out;
+    }
+    sigdelset(&wait_mask, SIGINT);
+    sigdelset(&wait_mask, SIGTERM);
+    struct sigaction action;
+    struct sigaction old_int;
+    struct sigaction old_term;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = watch_handle_signal;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGINT, &action, &old_int) == -1 || sigaction(SIGTERM, &action, &old_term) == -1) {
+        perror("Failed to install signal handlers");
+        sigprocmask(SIG_UNBLOCK, &stop_signals, NULL);
+        goto out;
+    }
+    ret = watch_loop(&state, archive_name, opts, &wait_mask);
+    // Unblocking first lets a signal that arrived during the final batch reach our handler
+    sigprocmask(SIG_UNBLOCK, &stop_signals, NULL);
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+
+out:
+    close(state.fd);
+    free(state.entries);
+    free(state.by_wd);
+    free(state.changed);
+    free(state.batch);
+    return ret;
 }
 
 int get_archive_file_list(const char *archive_name, file_list_t *files) {
+    //roll back an interrupted append first, so we never read a torn member
+    if(recover_archive(archive_name)!=0){
+        return -1;
+    }
     FILE  *fp = fopen(archive_name, "r");
     char err_msg[MAX_MSG_LEN];
     if(fp==NULL){
@@ -278,20 +1284,25 @@ int get_archive_file_list(const char *archive_name, file_list_t *files) {
         perror(err_msg);
         return -1;
     }
-    if(fseek(fp, -512, SEEK_END)!=0){
-        snprintf(err_msg, MAX_MSG_LEN, "Fseek() failed to reach end of archive %s", archive_name);
+    //hold off appends while reading; if one is still in progress (or can't be rolled back),
+    //stop at the last good end it recorded. closing fp releases the lock
+    off_t limit;
+    if(lock_archive_shared(archive_name, fileno(fp), &limit)!=0){
+        snprintf(err_msg, MAX_MSG_LEN, "Failed to lock archive %s", archive_name);
         perror(err_msg);
         fclose(fp);
         return -1;
     }
-    long int sz = ftell(fp);
-    //this will give us the end condition, when ftell is 512 bytes into the footer
-    if(sz==-1){
-        snprintf(err_msg, MAX_MSG_LEN, "Ftell() failed to reach end of archive %s", archive_name);
+    off_t end = limit;
+    if(limit==-1 && find_archive_end(fileno(fp), &end)!=0){
+        snprintf(err_msg, MAX_MSG_LEN, "Failed to find end of archive %s", archive_name);
         perror(err_msg);
         fclose(fp);
         return -1;
     }
+    //this will give us the end condition, when ftell is 512 bytes into the footer
+    //(the archive may be padded past the footer to a whole record, so we can't seek back from the end of the file)
+    long int sz = end + 512;
     //reset fp to start
     if(fseek(fp, 0, SEEK_SET)!=0){
         perror("fseek failed to reset to start of archive");
@@ -317,10 +1328,14 @@ int get_archive_file_list(const char *archive_name, file_list_t *files) {
     //I used -512, because the loop would read in 
     while(currenttell!=sz){
         //originally, I had ftell(fp) instead of currenttell, but I was told by a TA to do it this way for error checking
-        if(file_list_add(files, current_header.name)==1){
-            snprintf(err_msg, MAX_MSG_LEN, "File list add failed at %s", current_header.name);
+        //a name that fills the whole header field has no terminating null
+        char name[sizeof(current_header.name)+1];
+        snprintf(name, sizeof(name), "%.*s", (int)sizeof(current_header.name), current_header.name);
+        if(file_list_add(files, name)==1){
+            snprintf(err_msg, MAX_MSG_LEN, "File list add failed at %s", name);
             perror(err_msg);
             fclose(fp);
+            return -1;
         }
         //Realized that size was not the 512 multiple it needed to be, this will always round up from size to nearest multiple of 512
         //THis is converting to base 8, adding 511 (to round up) integer dividing by 512 and multiplying by 512 to give me the number of bits to offset the seek.
@@ -351,6 +1366,10 @@ int get_archive_file_list(const char *archive_name, file_list_t *files) {
 
 int extract_files_from_archive(const char *archive_name) {
     int trailingbytes;
+    //roll back an interrupted append first, so we never extract a torn member
+    if(recover_archive(archive_name)!=0){
+        return -1;
+    }
     char err_msg[MAX_MSG_LEN];
     FILE  *fp = fopen(archive_name, "r"); 
     FILE *fdest;
@@ -360,20 +1379,25 @@ int extract_files_from_archive(const char *archive_name) {
         //Can't close a null file pointer results in error
         return -1;
     }
-    //I probably do not need to error check every fseek but I figured better safe than sorry
-    if(fseek(fp, -512, SEEK_END)!=0){
-        perror("fseek() failed");
-            fclose(fp);
+    //hold off appends while reading; if one is still in progress (or can't be rolled back),
+    //stop at the last good end it recorded. closing fp releases the lock
+    off_t limit;
+    if(lock_archive_shared(archive_name, fileno(fp), &limit)!=0){
+        snprintf(err_msg, MAX_MSG_LEN, "Failed to lock archive %s", archive_name);
+        perror(err_msg);
+        fclose(fp);
         return -1;
     }
-    long int sz = ftell(fp);
-    //this will give us the end condition, when ftell is 512 bytes into the footer
-    if(sz==-1){
-        snprintf(err_msg, MAX_MSG_LEN, "Ftell() failed to reach end of archive %s", archive_name);
+    off_t end = limit;
+    if(limit==-1 && find_archive_end(fileno(fp), &end)!=0){
+        snprintf(err_msg, MAX_MSG_LEN, "Failed to find end of archive %s", archive_name);
         perror(err_msg);
         fclose(fp);
         return -1;
     }
+    //this will give us the end condition, when ftell is 512 bytes into the footer
+    //(the archive may be padded past the footer to a whole record, so we can't seek back from the end of the file)
+    long int sz = end + 512;
     int x = 0;
     char buffer[512];
     //I probably do not need to error check every fseek but I figured better safe than sorry
@@ -3,6 +3,14 @@
 #include "file_list.h"
 
 #define BLOCK_SIZE 512
+// Number of blocks per record when none is given, as in standard tar
+#define DEFAULT_BLOCKING_FACTOR 20
+#define MAX_BLOCKING_FACTOR 2048
+// Number of upcoming member files kept open and prefetched while writing the current one
+#define DEFAULT_PREFETCH_WINDOW 4
+#define MAX_PREFETCH_WINDOW 256
+// Milliseconds watch mode keeps collecting changes before archiving them
+#define DEFAULT_WATCH_WINDOW_MS 2000
 
 // Standard tar header layout defined by POSIX
 typedef struct {
@@ -49,24 +57,58 @@ typedef struct {
 #define REGTYPE '0'
 #define DIRTYPE '5'
 
+// Tunables for how archives are written
+typedef struct {
+    // Record size in blocks; archives are written and padded in whole records
+    int blocking_factor;
+    // Nonzero to write the archive with O_DIRECT, bypassing the page cache
+    int direct_io;
+    // How long watch mode coalesces changes, from the first change of a batch
+    int watch_window_ms;
+    // fdatasync the archive after every this many MB written, 0 to sync once per operation
+    int sync_interval_mb;
+    // Number of upcoming member files to open and prefetch ahead of the current one
+    int prefetch_window;
+    // Nonzero to leave out (after reporting) member files that can't be opened
+    // or aren't regular files, instead of failing the whole operation
+    int skip_unusable;
+} archive_options_t;
+
+// Initialize 'opts' with the default settings
+void archive_options_init(archive_options_t *opts);
+
 /*
  * Create a new archive file with the name 'archive_name'.
- * The archive should contain all files contained in the 'files' list.
- * You can assume in this project that at least one member file is specified.
- * You may also assume that all the elements of 'files' exist.
+ * The archive should contain all files named by the 'names' source, which is
+ * read one name at a time.
+ * You may assume that all the named files exist.
  * If an archive of the specified name already exists, you should overwrite it
- * with the result of this operation.
+ * with the result of this operation. The new archive is written to a temporary
+ * file and renamed into place, so a crash never leaves a partial archive.
+ * The archive is padded to a whole record of 'opts->blocking_factor' blocks.
  * This function should return 0 upon success or -1 if an error occurred
  */
-int create_archive(const char *archive_name, const file_list_t *files);
+int create_archive(const char *archive_name, file_source_t *names, const archive_options_t *opts);
+
+/*
+ * Append each file named by the 'names' source to the archive with the name 'archive_name'.
+ * You may assume that all files to be appended exist.
+ * The old end of the archive is journaled first, so an append that fails or is
+ * interrupted by a crash is rolled back, by this or any later operation.
+ * The archive is padded to a whole record of 'opts->blocking_factor' blocks.
+ * This function should return 0 upon success or -1 if an error occurred.
+ */
+int append_files_to_archive(const char *archive_name, file_source_t *names, const archive_options_t *opts);
 
 /*
- * Append each file specified in 'files' to the archive with the name 'archive_name'.
- * You can assume in this project that at least one new file to append is specified.
- * You may also assume that all files to be appended exist.
+ * Watch each file named by the 'names' source with inotify, and append the
+ * files that change to the archive with the name 'archive_name'.
+ * Changes are coalesced over 'opts->watch_window_ms' and appended in one batch
+ * with append_files_to_archive, so work is proportional to what changed.
+ * Runs until SIGINT or SIGTERM, after which pending changes are appended.
  * This function should return 0 upon success or -1 if an error occurred.
  */
-int append_files_to_archive(const char *archive_name, const file_list_t *files);
+int watch_archive(const char *archive_name, file_source_t *names, const archive_options_t *opts);
 
 /*
  * Add the name of each file contained in the archive identified by 'archive_name'
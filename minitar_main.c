@@ -1,34 +1,125 @@
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "file_list.h"
 #include "minitar.h"
 
+/*
+ * Frees the command line file list and closes the -T list file, if any
+ */
+void cleanup(file_list_t *files, FILE *list_file) {
+    file_list_clear(files);
+    if (list_file != NULL && list_file != stdin) {
+        fclose(list_file);
+    }
+}
+
 int main(int argc, char **argv) {
     if (argc < 4) {
-        printf("Usage: %s -c|a|t|u|x -f ARCHIVE [FILE...]\n", argv[0]);
+        printf("Usage: %s -c|a|t|u|w|x -f ARCHIVE [-b BLOCKS] [--direct] [-T LISTFILE [--null]] [--window MS] [--sync-mb N] [--prefetch K] [FILE...]\n", argv[0]);
         return 1;
         //The given code has this set to 0, but the project page says errors should return 1 so I changed it
     }
-    char err_msg[512];
+    const char *archive_name = NULL;
+    const char *list_name = NULL;
+    char list_delim = '\n';
+    archive_options_t opts;
+    archive_options_init(&opts);
     file_list_t files;
     file_list_init(&files);
-    for(int x=4; x<argc;x++){
-        if(file_list_add(&files,argv[x])!=0){
-            printf(err_msg, 512, "Failed to add file to list %s", argv[x]);
+    for(int x=2; x<argc;x++){
+        if(strcmp("-f", argv[x])==0 && x+1<argc){
+            archive_name = argv[++x];
+        }
+        else if(strcmp("-b", argv[x])==0 && x+1<argc){
+            //blocking factor, the archive is written in records of this many 512 byte blocks
+            char *end;
+            long blocks = strtol(argv[++x], &end, 10);
+            if(*end!='\0' || blocks<1 || blocks>MAX_BLOCKING_FACTOR){
+                printf("Invalid blocking factor %s (must be 1-%d)\n", argv[x], MAX_BLOCKING_FACTOR);
+                file_list_clear(&files);
+                return 1;
+            }
+            opts.blocking_factor = blocks;
+        }
+        else if(strcmp("--direct", argv[x])==0){
+            opts.direct_io = 1;
+        }
+        else if(strcmp("-T", argv[x])==0 && x+1<argc){
+            //names are read from this file (or stdin for -) as they are needed, rather than all held in memory
+            list_name = argv[++x];
+        }
+        else if(strcmp("--window", argv[x])==0 && x+1<argc){
+            //watch mode collects changes for this many milliseconds before archiving them
+            char *end;
+            long window = strtol(argv[++x], &end, 10);
+            if(*end!='\0' || window<0 || window>3600000){
+                printf("Invalid watch window %s (must be 0-3600000 ms)\n", argv[x]);
+                file_list_clear(&files);
+                return 1;
+            }
+            opts.watch_window_ms = window;
+        }
+        else if(strcmp("--sync-mb", argv[x])==0 && x+1<argc){
+            //also flush the archive to disk after every N MB written, rather than only once at the end
+            char *end;
+            long interval = strtol(argv[++x], &end, 10);
+            if(*end!='\0' || interval<0 || interval>1048576){
+                printf("Invalid sync interval %s (must be 0-1048576 MB)\n", argv[x]);
+                file_list_clear(&files);
+                return 1;
+            }
+            opts.sync_interval_mb = interval;
+        }
+        else if(strcmp("--prefetch", argv[x])==0 && x+1<argc){
+            //number of upcoming files to open and start reading while the current one is archived
+            char *end;
+            long window = strtol(argv[++x], &end, 10);
+            if(*end!='\0' || window<0 || window>MAX_PREFETCH_WINDOW){
+                printf("Invalid prefetch window %s (must be 0-%d)\n", argv[x], MAX_PREFETCH_WINDOW);
+                file_list_clear(&files);
+                return 1;
+            }
+            opts.prefetch_window = window;
+        }
+        else if(strcmp("--null", argv[x])==0){
+            //names in the -T file are separated by NUL instead of newline, e.g. the output of find -print0
+            list_delim = '\0';
+        }
+        else if(file_list_add(&files,argv[x])!=0){
+            fprintf(stderr, "Failed to add file to list %s: %s\n", argv[x], strerror(errno));
+            file_list_clear(&files);
+            return 1;
+        }
+    }
+    FILE *list_file = NULL;
+    if(list_name!=NULL){
+        list_file = strcmp("-", list_name)==0 ? stdin : fopen(list_name, "r");
+        if(list_file==NULL){
+            perror("Failed to open -T list file");
             file_list_clear(&files);
             return 1;
         }
     }
+    //Command line names come first, then any names from the list file
+    file_source_t names;
+    file_source_init(&names, &files, list_file, list_delim);
+    if(archive_name==NULL){
+        printf("Usage: %s -c|a|t|u|w|x -f ARCHIVE [-b BLOCKS] [--direct] [-T LISTFILE [--null]] [--window MS] [--sync-mb N] [--prefetch K] [FILE...]\n", argv[0]);
+        cleanup(&files, list_file);
+        return 1;
+    }
     //This creates the file list struct and populates it with arguments from the console (If any files are mentioned)
 
     if (strcmp("-c", argv[1]) == 0) {
         //Simple create job see minitar.c for more info
-            if(create_archive(argv[3],&files)!=0){
+            if(create_archive(archive_name,&names,&opts)!=0){
                 //free and return if error
                 //error messages are found in minitar.c commands
                 perror("-c Create option failed");
-                file_list_clear(&files);
+                cleanup(&files, list_file);
                 return 1;
             }
         //This command is capable of creating an empty archive, only consisting of 1024 0 bytes. 
@@ -36,22 +127,22 @@ int main(int argc, char **argv) {
         }
     if (strcmp("-a", argv[1]) == 0) {
         //Simple append job see minitar.c for more info
-            if(append_files_to_archive(argv[3],&files)!=0){
+            if(append_files_to_archive(archive_name,&names,&opts)!=0){
                 //free and return if error
                 //error messages are found in minitar.c commands
                 perror("-a Append option failed");
-                file_list_clear(&files);
+                cleanup(&files, list_file);
                 return 1;
             }
         }
     if (strcmp("-t", argv[1]) == 0) {
             file_list_clear(&files);
             //make sure there are no existing files to mess things up, as we can pass in irrelevant arguments
-            if(get_archive_file_list(argv[3],&files)!=0){
+            if(get_archive_file_list(archive_name,&files)!=0){
                 //free and return if error
                 //error messages are found in minitar.c commands
                 perror("-t Option failed");
-                file_list_clear(&files);
+                cleanup(&files, list_file);
                 return 1;
             }
             else{
@@ -68,41 +159,72 @@ int main(int argc, char **argv) {
         file_list_t currentlyinarchive;
         file_list_init(&currentlyinarchive);
         //Get file list will error if archive does not exist, as will append
-            if(get_archive_file_list(argv[3],&currentlyinarchive)!=0){
+            if(get_archive_file_list(archive_name,&currentlyinarchive)!=0){
                 //populate the list, if successful continue, otherwise free and terminate.
-                file_list_clear(&files);
+                cleanup(&files, list_file);
                 file_list_clear(&currentlyinarchive);
                 //error messages are found in minitar.c commands
                 return 1;
             }
             else{
-                if(file_list_is_subset(&files, &currentlyinarchive)!=1){
-                        printf("Error: One or more of the specified files is not already present in archive");
+                //Check every name before appending anything, so the names are read twice
+                //same size as the header name field, like the names create and append accept
+                char name[sizeof(((tar_header *)0)->name)];
+                int status;
+                while((status = file_source_next(&names, name, sizeof(name)))==1 && file_list_contains(&currentlyinarchive, name)){
+                }
+                if(status==-1 && errno==ENAMETOOLONG){
+                    //too long to be the name of any archive member
+                    status = 1;
+                }
+                if(status!=0){
+                        if(status==1){
+                            printf("Error: One or more of the specified files is not already present in archive");
+                        }
+                        else{
+                            perror("Failed to read file names");
+                        }
                         file_list_clear(&currentlyinarchive);
-                        file_list_clear(&files);
+                        cleanup(&files, list_file);
                         //If there is a file in the arguments that DNE in the archive free and terminate.
                         return 1;
                     }
+                //a list file has to be read again from the start, which stdin usually can't do
+                if(list_file!=NULL && fseek(list_file, 0, SEEK_SET)!=0){
+                    perror("-u needs a seekable -T list file");
+                    file_list_clear(&currentlyinarchive);
+                    cleanup(&files, list_file);
+                    return 1;
+                }
+                file_source_init(&names, &files, list_file, list_delim);
                 //if all are present then we update
-                if(append_files_to_archive(argv[3],&files)!=0){
+                if(append_files_to_archive(archive_name,&names,&opts)!=0){
                     perror("Failed to append files exiting...");
                     file_list_clear(&currentlyinarchive);
-                        file_list_clear(&files);
+                        cleanup(&files, list_file);
                         return 1;
                 }
                 }
             file_list_clear(&currentlyinarchive);
             //clear the new file list (in archive not arguments.)
             }
+    if (strcmp("-w", argv[1]) == 0) {
+        //long running, appends files from the arguments as they change until interrupted
+        if(watch_archive(archive_name,&names,&opts)!=0){
+            perror("-w Watch option failed");
+            cleanup(&files, list_file);
+            return 1;
+        }
+    }
     if (strcmp("-x", argv[1]) == 0) {
         //if x run extract files, if error return 1 and clear. else nothing. 
-        if(extract_files_from_archive(argv[3])!=0){
+        if(extract_files_from_archive(archive_name)!=0){
             //Only the most recent updated file is extracted
-            file_list_clear(&files);
+            cleanup(&files, list_file);
             return 1;
         }
     }
     //if no errors, clear files and return 0
-    file_list_clear(&files);
+    cleanup(&files, list_file);
     return 0;
 }
@@ -0,0 +1,14 @@
+#!/usr/bin/env python3
+# Writes the journal minitar leaves behind when an append to ARCHIVE is
+# interrupted, recording that the archive last ended at OLD_END and was
+# OLD_SIZE bytes long.
+# Usage: plant_journal.py ARCHIVE OLD_END OLD_SIZE
+import os
+import struct
+import sys
+
+archive, old_end, old_size = sys.argv[1], int(sys.argv[2]), int(sys.argv[3])
+st = os.stat(archive)
+fields = (st.st_dev, st.st_ino, old_end, old_size)
+with open(archive + ".journal", "wb") as f:
+    f.write(struct.pack("<8s5Q", b"MTARJNL", *fields, sum(fields) % 2**64))